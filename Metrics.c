@@ -0,0 +1,172 @@
+/****** Metrics.c **********************************************
+ *
+ * Relative humidity from a raw SHT15 reading, and the metrics derived
+ * from a temperature/humidity pair: heat index, dew point, absolute
+ * humidity and vapor pressure deficit. Nothing here touches the
+ * hardware, so tests/test_metrics.c builds it on the host.
+ *
+ **********************************************************************/
+#include "math.h"
+
+// Metrics computed from each temperature/humidity pair, in alarm priority order
+#define METRIC_HEATINDEX 0          // C
+#define METRIC_DEWPOINT 1           // C
+#define METRIC_ABSHUMID 2           // g/m^3
+#define METRIC_VPD 3                // kPa
+#define METRIC_COUNT 4
+
+// Saturation vapor pressure over water in Pa, 1 C steps from -40 to 80 C
+// (Magnus formula with the same Tn = 243.12, m = 17.62 as the dew point)
+#define SVP_TMIN -40
+#define SVP_TMAX 80
+const unsigned int SatVaporTable[SVP_TMAX - SVP_TMIN + 1] = {
+      19,    21,    23,    26,    29,    32,    35,    38,    42,    47,  // -40..-31 C
+      51,    56,    62,    68,    74,    81,    89,    97,   106,   116,  // -30..-21 C
+     126,   137,   149,   163,   177,   192,   208,   226,   245,   265,  // -20..-11 C
+     287,   310,   336,   363,   391,   422,   455,   490,   528,   568,  // -10..-1 C
+     611,   657,   706,   758,   813,   872,   934,  1001,  1071,  1146,  // 0..9 C
+    1226,  1310,  1400,  1495,  1595,  1702,  1814,  1933,  2059,  2192,  // 10..19 C
+    2333,  2481,  2637,  2803,  2977,  3160,  3353,  3557,  3771,  3997,  // 20..29 C
+    4234,  4483,  4745,  5020,  5309,  5613,  5931,  6265,  6616,  6983,  // 30..39 C
+    7367,  7770,  8192,  8634,  9096,  9580, 10085, 10614, 11166, 11743,  // 40..49 C
+   12345, 12974, 13630, 14315, 15029, 15774, 16550, 17359, 18202, 19080,  // 50..59 C
+   19993, 20944, 21934, 22963, 24034, 25147, 26304, 27506, 28754, 30051,  // 60..69 C
+   31398, 32795, 34246, 35751, 37311, 38930, 40608, 42347, 44149, 46015,  // 70..79 C
+   47949};                                                               // 80 C
+
+/****** SatVapor ********************************************************
+ *
+ * Look up saturation vapor pressure (Pa) for a temperature given in
+ * hundredths of a degree C, interpolating between 1 C table entries.
+ *
+ **********************************************************************/
+unsigned int SatVapor(int tc)
+{
+   int index;
+   int frac;
+   unsigned int lo;
+
+   if (tc <= SVP_TMIN*100)
+   {
+      return SatVaporTable[0];
+   }
+   if (tc >= SVP_TMAX*100)
+   {
+      return SatVaporTable[SVP_TMAX - SVP_TMIN];
+   }
+   index = (tc - SVP_TMIN*100) / 100;
+   frac = (tc - SVP_TMIN*100) % 100;
+   lo = SatVaporTable[index];
+   return lo + (unsigned int)(((unsigned long)(SatVaporTable[index + 1] - lo) * frac) / 100);
+}
+
+/****** VaporDewPoint ********************************************************
+ *
+ * Invert the saturation vapor pressure table: the dew point is the
+ * temperature at which the actual vapor pressure e (Pa) saturates.
+ *
+ **********************************************************************/
+float VaporDewPoint(unsigned int e)
+{
+   char lo = 0;
+   char hi = SVP_TMAX - SVP_TMIN;
+   char mid;
+
+   if (e <= SatVaporTable[lo])
+   {
+      return SVP_TMIN;
+   }
+   if (e >= SatVaporTable[hi])
+   {
+      return SVP_TMAX;
+   }
+   while (hi - lo > 1)           // Binary search for the bracketing entries
+   {
+      mid = (lo + hi) >> 1;
+      if (SatVaporTable[mid] <= e)
+      {
+         lo = mid;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+   return SVP_TMIN + lo + (float)(e - SatVaporTable[lo]) / (SatVaporTable[hi] - SatVaporTable[lo]);
+}
+
+/****** RelHumidity ********************************************************
+ *
+ * Convert a raw 12-bit SHT15 humidity reading to %RH with the datasheet
+ * polynomial, compensated for a sensor temperature T (C) away from
+ * 25 C and clamped to 0..100.
+ *
+ **********************************************************************/
+float RelHumidity(int raw, float T)
+{
+   float c1 = -2.0468;
+   float c2 = 0.0367;
+   float c3 = -0.0000015955;
+   float t1 = 0.01;
+   float t2 = 0.00008;
+   float RH;
+
+   RH = c1 + (c2*raw) + (c3*((float)raw*raw));
+   RH += (T - 25)*(t1 + (t2*raw));
+   if (RH > 100)
+   {
+      RH = 100;
+   }
+   else if (RH < 0)
+   {
+      RH = 0;
+   }
+   return RH;
+}
+
+/****** HeatIndex ********************************************************
+ *
+ * NWS heat index in C: Steadman's simple formula, switching to the
+ * Rothfusz regression (with its low/high humidity adjustments) once
+ * the result reaches 80 F.
+ **********************************************************************/
+float HeatIndex(float T, float RH)
+{
+   float F = T*1.8 + 32;
+   float HI = 0.5*(F + 61.0 + ((F - 68.0)*1.2) + (RH*0.094));
+
+   if ((HI + F)/2 >= 80)
+   {
+      HI = -42.379 + 2.04901523*F + 10.14333127*RH - 0.22475541*F*RH
+           - 0.00683783*F*F - 0.05481717*RH*RH + 0.00122874*F*F*RH
+           + 0.00085282*F*RH*RH - 0.00000199*F*F*RH*RH;
+      if (RH < 13 && F >= 80 && F <= 112)
+      {
+         HI -= ((13 - RH)/4)*sqrt((17 - fabs(F - 95))/17);
+      }
+      else if (RH > 85 && F >= 80 && F <= 87)
+      {
+         HI += ((RH - 85)/10)*((87 - F)/5);
+      }
+   }
+   return (HI - 32)/1.8;
+}
+
+/****** ComputeMetrics ********************************************************
+ *
+ * Compute every derived metric from one temperature/humidity pair into
+ * out[METRIC_COUNT]. The saturation vapor pressure lookup is the one
+ * shared step; dew point, absolute humidity and VPD all follow from it
+ * without log().
+ *
+ **********************************************************************/
+void ComputeMetrics(float T, float RH, float *out)
+{
+   unsigned int es = SatVapor((int)(T*100));
+   unsigned int e = (unsigned int)(es*RH/100);                // Actual vapor pressure
+
+   out[METRIC_HEATINDEX] = HeatIndex(T, RH);
+   out[METRIC_DEWPOINT] = VaporDewPoint(e);
+   out[METRIC_ABSHUMID] = 2.1667*e/(T + 273.15);              // g/m^3
+   out[METRIC_VPD] = (es - e)/1000.0;                         // kPa
+}
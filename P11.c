@@ -5,10 +5,20 @@
  * 
  * Interface with the SHT15 sensor using digital 2-wire interface.
  * Poll the SHT15 for temperature and humidity measurements approx every
- * 2 seconds. Also calculates and displays dewpoint based on temp and humidity.
+ * 2 seconds. Also calculates and displays dewpoint, heat index, absolute
+ * humidity and vapor pressure deficit based on temp and humidity.
+ * Readings, setpoints, history and diagnostics each have their own page;
+ * only the page on screen is drawn. Samples reach alerts, metrics and
+ * the display as events, so nothing runs until new data arrives.
+ * Temperature is corrected per unit from reference points captured on
+ * the calibration page and saved in flash.
  * Allows user to set min and max values on humidty and triggers alerts
  * during a breach in the form of an on-screen display as well as 
- * a high-pitch alarm speaker controlled with RD0.
+ * a high-pitch alarm speaker controlled with RD0. Each alert plays a
+ * tone pattern for its severity from OC1 PWM; the pushbutton
+ * acknowledges and snoozes the sounding alarms.
+ * A watchdog supervisor resets the board if a critical task misses its
+ * deadline; after such a reset only the sensors and alarm run (no LCD).
  * 
  **********************************************************************/
 #include "p24FJ256GB110.h"       // PIC24 register and bit definitions
@@ -19,9 +29,10 @@
 #include "MikroDebug.c"          // Debugging functions
 #include "MikroI2C.c"            // I2C functions
 #include "math.h"                // Math libraries used for calculating dew point
+#include "Metrics.c"             // Heat index, dew point, absolute humidity, VPD
 
 /****** Configuration selections **************************************/
-_CONFIG1(JTAGEN_OFF & GWRP_OFF & FWDTEN_OFF & ICS_PGx2);
+_CONFIG1(JTAGEN_OFF & GWRP_OFF & FWDTEN_ON & FWPSA_PR32 & WDTPS_PS1024 & ICS_PGx2);  // WDT ~1 s
 _CONFIG2(PLLDIV_DIV2 & POSCMOD_HS & FNOSC_PRIPLL & IOL1WAY_OFF);
 
 /****** Global variables **********************************************/
@@ -42,14 +53,12 @@ char HumidityDec[] = "\005\0010000";
 char HumidityRel[] = "\006\001000.00%";
 char DewPointstr[] = "\003\001000.00 C";
 
-char TargetStr1[] = "\002\003Max Temp: 00  C";
-char TargetStr3[] = "\002\003Min Temp: 00  C";
-char TargetStr2[] = "\002\003Max Humid: 000%";
-char TargetStr4[] = "\002\003Min Humid: 000%";
-
 char CurTempStr[] = "\005\015Temp: 00.00 C";
 char CurHumidStr[] = "\006\014Humid: 00.00 %";
 char CurDewPointStr[] = "\007\013DewPnt: 00.00 C";
+char HeatIndexStr[] = "\010\012HeatIdx: 000.0 C";
+char AbsHumidStr[] = "\011\013AbsHum: 00.0g/m3";
+char VPDStr[] = "\012\016VPD: 00.00kPa";
 
 char AlertStr1[] = "\003\011!!!";
 char AlertStr2[] = "\004\011!!!";
@@ -63,24 +72,28 @@ char BlankStr4[] = "\004\026   ";
 float CurrentTemp;
 float CurrentHumidity;
 
-char TargetChange = 0;
-
 char IsConfirmed = 0;           // boolean to tell wether the user pressed the pushbutton
 
 char MaxTemp = 50;
 char MinTemp = -10;
 char MaxHumid = 100;
 char MinHumid = 0;
-char MaxTempCpy = 50;
-char MaxHumidCpy = 100;
-char MinTempCpy = -10;
-char MinHumidCpy = 0;
 
 
 signed char DELRPG = 0;         // Change variable for RPG
 unsigned int OLDRPG, NEWRPG;    // Variables to detect a change in the RPG value
 
 
+/****** Types *********************************************************/
+typedef struct
+{
+   char type;                  // EV_TEMP, EV_PAIR, ...
+   float temp;                 // C
+   float humid;                // %RH, EV_PAIR only
+} Event;
+
+typedef void (*EventHandler)(Event *ev);
+
 /****** Function prototypes *******************************************/
 void Initial(void);
 void BlinkAlive(void);
@@ -91,10 +104,52 @@ int BoundsDetect(int x1, int y1, int x2, int y2);
 void ReadHumidity(void);
 void ReadTemp(void);
 void DewPoint(void);
-void InitDisplay(void);
-void DetectTarget(void);
+float RelHumidity(int raw, float T);
+void ComputeMetrics(float T, float RH, float *out);
+void DerivedMetrics(float T, float RH);
+void DisplayMetrics(void);
+void FormatFixed(char *str, char pos, char digits, char decimals, float value);
+void FormatHex(char *str, char pos, char digits, unsigned int value);
+void SwitchPage(signed char page);
+void PageService(void);
+void RenderLive(void);
+void RenderSetpoints(void);
+void RenderHistory(void);
+void RenderDiag(void);
+void ShowTemp(void);
+void ShowHumidity(void);
+void ShowSetpoint(char k);
+void SelectSetpoint(char k);
+void HistoryAdd(Event *ev);
+void PlotColumn(unsigned char i);
+void ShowDiag(void);
 void SelectBound(void);
-void CheckAlerts(void);
+void CheckAlerts(Event *ev);
+void Publish(char type, float temp, float humid);
+void EventDispatch(void);
+void StoreSample(Event *ev);
+void DisplayEvent(Event *ev);
+void InitCal(void);
+int CalMap(int m);
+void CalBuild(void);
+int CalCorrect(unsigned int raw);
+void CalCapture(int ref);
+void CalClear(void);
+void CalSave(void);
+void FlashWord(unsigned int offset, unsigned int value);
+void CalService(void);
+void CalEvent(Event *ev);
+void RenderCal(void);
+void ShowCal(void);
+void InitAlarm(void);
+void AlarmUpdate(unsigned int active);
+signed char AlarmTop(void);
+char AlarmButton(char pressed);
+void InitSupervisor(void);
+void TaskEnter(char id);
+void TaskDone(char id);
+void Supervise(void);
+void DrawAlert(unsigned int color, char *str);
 
 /****** Macros ********************************************************/
 #define BLACK RGB(0,0,0)
@@ -114,6 +169,211 @@ void CheckAlerts(void);
 #define TEAL RGB(0,128,128)
 #define AQUA RGB(0,255,255)
 
+/****** Alarm output ***************************************************/
+// Alarm sources in priority order (bit 0 is the most urgent)
+#define ALARM_MAXTEMP 0
+#define ALARM_MINTEMP 1
+#define ALARM_MAXHUMID 2
+#define ALARM_MINHUMID 3
+#define ALARM_METRICS 4             // First of one source per derived metric
+#define ALARM_COUNT 8
+
+#define SEV_CRITICAL 0
+#define SEV_WARNING 1
+#define SEV_ADVISORY 2
+
+#define ALARM_SNOOZE_TICKS 3000     // 5 min of 100 ms Timer4 ticks
+
+const char AlarmSeverity[ALARM_COUNT] = {SEV_CRITICAL, SEV_WARNING, SEV_ADVISORY, SEV_ADVISORY,
+                                         SEV_WARNING, SEV_ADVISORY, SEV_ADVISORY, SEV_ADVISORY};
+
+// OC1 PWM period for each severity with Fcy = 16 MHz: 3 kHz, 2 kHz, 1 kHz
+const unsigned int TonePeriod[3] = {5332, 7999, 15999};
+// On/off cadence, one bit per 100 ms slot (LSB first, 1.6 s cycle)
+const unsigned int ToneCadence[3] = {0x5555, 0x0F0F, 0x0003};
+
+unsigned int AlarmActive = 0;          // Bit n set while source n is breached
+unsigned int AlarmAcked = 0;           // Bit n set once source n is acknowledged
+volatile unsigned int SnoozeTicks = 0; // Ticks left before acked alarms re-sound
+volatile signed char AlarmTone = -1;   // Severity being played, -1 for silence
+volatile char CadenceSlot = 0;         // Current bit of the cadence pattern
+volatile unsigned int SysTicks = 0;    // Timer4 ticks (100 ms) since reset
+volatile unsigned int Uptime = 0;      // Seconds since reset
+
+#ifdef ALARM_TRACE
+// Waveform log for the host simulator: one entry per change of OC1 output
+#define TRACE_LEN 64
+unsigned char TraceHead = 0;           // Next entry to write
+unsigned int TraceLog[TRACE_LEN][3];   // {tick, OC1RS period, OC1R duty}
+#endif
+
+/****** Derived metrics **********************************************/
+// Metric ids, SatVaporTable and the math itself are in Metrics.c
+float Metric[METRIC_COUNT];            // Latest value of each metric
+char MetricsValid = 0;                 // Set once the first pair is converted
+unsigned int MetricAlerts = 0;         // Bit n set while metric n is over its limit
+// Upper alert limits, edited on the setpoint page. METRIC_OFF (the top of
+// each range) disables the alert, so no metric alarms until the user sets it.
+#define METRIC_OFF 127
+char MetricMax[METRIC_COUNT] = {METRIC_OFF, METRIC_OFF, METRIC_OFF, METRIC_OFF};
+const float MetricUnit[METRIC_COUNT] = {1.0, 1.0, 1.0, 0.1};  // Limits in C, C, g/m^3, hPa
+
+/****** Event bus *****************************************************/
+// Event types
+#define EV_TEMP 0                   // New temperature
+#define EV_PAIR 1                   // New humidity with the temperature it was compensated for
+#define EV_SETPOINT 2               // A setpoint was saved
+#define EV_SNOOZE 3                 // Alarm snooze ran out
+#define EV_COUNT 4
+
+#define EVENT_QLEN 16               // Power of two
+#define EV_SUBS 4                   // Most subscribers for one event type
+
+// Subscribers for each event type, called in order until a null entry
+const EventHandler Subscribers[EV_COUNT][EV_SUBS] = {
+   {StoreSample, CheckAlerts, DisplayEvent, CalEvent},     // EV_TEMP
+   {StoreSample, CheckAlerts, DisplayEvent, HistoryAdd},   // EV_PAIR
+   {CheckAlerts, 0, 0, 0},                                 // EV_SETPOINT
+   {CheckAlerts, 0, 0, 0}};                                // EV_SNOOZE
+
+Event EventQueue[EVENT_QLEN];
+volatile unsigned char EventHead = 0;  // Next slot to fill, moved by Publish()
+volatile unsigned char EventTail = 0;  // Next slot to read, moved by EventDispatch()
+unsigned int EventDrops = 0;           // Events lost to a full queue
+
+float SensorTemp = 25;                 // Last temperature read, for RH compensation
+unsigned int SensorRaw = 6470;         // Last raw temperature reading (25 C)
+char SensorValid = 0;                  // Set once SensorRaw holds a real reading
+
+/****** Calibration ***************************************************/
+// Raw SHT15 temperature counts convert as d1 + d2*raw with d1 = -39.70 C
+// and d2 = 0.01 C, i.e. exactly raw - 3970 in hundredths of a degree.
+#define CAL_D1 -3970                // d1 in 0.01 C
+#define CAL_POINTS 8                // Most reference points kept
+#define CAL_SHIFT 8                 // 256 raw counts (2.56 C) between table nodes
+#define CAL_NODES 65                // Covers the 14-bit raw range 0..16383
+#define CAL_KEY 0xCA1B              // Marks the flash page as holding points
+#define CAL_PAGE_WORDS 512          // One erase page of program flash
+
+// Reference points, sorted by measured value, both in 0.01 C
+int CalMeas[CAL_POINTS];               // Uncorrected sensor temperature
+int CalRefPt[CAL_POINTS];              // Reference thermometer temperature
+char CalCount = 0;
+int CalTable[CAL_NODES];               // Corrected 0.01 C at every 256th raw count
+int CalRef = 2500;                     // Reference being entered, 0.01 C
+
+// Saved points: {CAL_KEY, count, measured0, reference0, ...}
+// noload only keeps the hex file from programming this page. A programmer
+// still erases it with the rest of flash unless its address range is set
+// to be preserved, so reflashing without that loses the calibration.
+const unsigned int CalFlash[CAL_PAGE_WORDS] __attribute__((space(prog), aligned(1024), noload));
+
+// Written from the debugger to calibrate from the host
+#define HOST_NONE 0
+#define HOST_CAPTURE 1              // Capture a point, HostArg = reference in 0.01 C
+#define HOST_CLEAR 2
+#define HOST_SAVE 3
+volatile char HostCmd = HOST_NONE;
+volatile int HostArg = 0;
+
+char CalSensorStr[] = "\003\001Sensor:    000.00 C";
+char CalRefStr[] = "\004\001Reference: 000.00 C";
+char CalFixStr[] = "\005\001Corrected: 000.00 C";
+char CalPointsStr[] = "\007\001Points: 0 of 8";
+
+/****** Pages *********************************************************/
+#define PAGE_NONE -1                // Degraded mode: nothing is drawn
+#define PAGE_LIVE 0
+#define PAGE_SETPOINT 1
+#define PAGE_HISTORY 2
+#define PAGE_DIAG 3
+#define PAGE_CAL 4
+#define PAGE_COUNT 5
+
+signed char Page = PAGE_NONE;          // Page currently on screen
+char LiveRedraw = 0;                   // Redraw live widgets even if unchanged
+
+// Tabs across row 2, five columns (60 pixels) apart
+char TabStr[PAGE_COUNT][7] = {"\002\001Live", "\002\006Set", "\002\013Hist",
+                              "\002\020Diag", "\002\025Cal"};
+
+// Setpoints listed on rows 3-10 of the setpoint page
+#define SETPOINT_COUNT 8
+char *const Setpoint[SETPOINT_COUNT] = {&MaxTemp, &MinTemp, &MaxHumid, &MinHumid,
+                                        &MetricMax[METRIC_HEATINDEX], &MetricMax[METRIC_DEWPOINT],
+                                        &MetricMax[METRIC_ABSHUMID], &MetricMax[METRIC_VPD]};
+#define SETPOINT_METRIC 4              // First metric limit row
+const char SetpointLow[SETPOINT_COUNT] = {-10, -10, 0, 0, 20, -10, 0, 0};
+const char SetpointHigh[SETPOINT_COUNT] = {50, 50, 100, 100,
+                                           METRIC_OFF, METRIC_OFF, METRIC_OFF, METRIC_OFF};
+char SetpointStr[SETPOINT_COUNT][22] = {"\003\003Max Temp:  000 C", "\004\003Min Temp:  000 C",
+                                        "\005\003Max Humid: 000 %", "\006\003Min Humid: 000 %",
+                                        "\007\003Max HtIdx: 000 C", "\010\003Max DewPt: 000 C",
+                                        "\011\003Max AbsH:  000 g/m3",
+                                        "\012\003Max VPD:   000 hPa"};
+char Selected = 0;                     // Setpoint adjusted by the RPG
+char EditValue = 50;                   // Its value until the pushbutton confirms
+
+// History plot: one point every HIST_EVERY humidity readings (30 s)
+#define HIST_LEN 100
+#define HIST_EVERY 15
+signed char HistTemp[HIST_LEN];        // C
+unsigned char HistHumid[HIST_LEN];     // %
+unsigned char HistHead = 0;            // Next slot to write
+unsigned char HistCount = 0;           // Slots filled so far
+
+char DiagResetStr[] = "\003\001Reset: 0x0000 task 0";
+char DiagFaultStr[] = "\004\001Fault resets: 00000";
+char DiagAlarmStr[] = "\005\001Alarms: 0x00 ack 0x00";
+char DiagSnoozeStr[] = "\006\001Snooze: 00000 s";
+char DiagUptimeStr[] = "\007\001Uptime: 00000 s";
+char DiagDropStr[] = "\010\001Event drops: 00000";
+
+/****** Supervisor ***************************************************/
+// Main-loop tasks, recorded in LastTask as each one starts
+#define TASK_NONE 0
+#define TASK_TOUCH 1
+#define TASK_PAGE 2
+#define TASK_RPG 3
+#define TASK_BOUND 4
+#define TASK_HUMID 5
+#define TASK_TEMP 6
+#define TASK_EVENTS 7
+#define TASK_CAL 8
+#define TASK_IDLE 9
+#define TASK_COUNT 10
+
+#define LOOP_COUNTS 625             // 10 ms loop period in Timer3 counts
+#define OVERRUN_LIMIT 2             // Consecutive unexplained loop overruns allowed
+#define PERSIST_KEY 0xA5C3          // Marks persistent RAM as valid
+#define RCON_FAULTS 0xC010          // TRAPR, IOPUWR and WDTO reset flags
+
+// Ticks allowed between completions of each task, 0 if not checked.
+// Sensors deliver a sample about every 2 s.
+const unsigned int TaskDeadline[TASK_COUNT] = {0, 0, 0, 0, 0, 40, 40, 0, 0, 0};
+// Timer3 counts (16 us) each critical task may take from TaskEnter() to
+// TaskDone(): 150 ms for an RH read, 400 ms for a 14-bit temperature
+// read, 100 ms to dispatch events including redraws. 0 if not timed.
+const unsigned int TaskBudget[TASK_COUNT] = {0, 0, 0, 0, 0, 9375, 25000, 6250, 0, 0};
+
+unsigned int TaskStamp[TASK_COUNT];    // SysTicks at each task's last completion
+unsigned int TaskStart[TASK_COUNT];    // TMR3 when each task last started
+char FaultTask = TASK_NONE;            // First task to overrun its budget
+char Excused = 0;                      // Loop overran inside a task within budget
+char Degraded = 0;                     // Alerts only, no graphics
+
+// Survive a watchdog reset; cleared on power-on
+unsigned int PersistKey __attribute__((persistent));
+unsigned int ResetCause __attribute__((persistent));  // RCON at the last reset
+unsigned int WdtResets __attribute__((persistent));   // Fault resets since power-on
+char LastTask __attribute__((persistent));            // Task running now
+char ResetTask __attribute__((persistent));           // Task running at the last reset
+
+#ifdef SUPERVISOR_TEST
+// Set by the host simulator to make a task hang on its next start
+char HangTask __attribute__((persistent));
+#endif
+
 //////// Main program //////////////////////////////////////////////////
 
 int main()
@@ -123,13 +383,32 @@ int main()
    while (1)                     // Looptime without Sleep = 20.35 ms
    {
       
-	  DetectTouch();             // Detect current touch on screen
-	  DetectTarget();            // Determine if target value has changed
-	  RPG();                     // Update DELRPG value
-	  SelectBound();             // Change a target value based on DELRPG
+	  if(!Degraded)
+	  {
+		  TaskEnter(TASK_TOUCH);
+		  DetectTouch();         // Detect current touch on screen
+		  TaskEnter(TASK_PAGE);
+		  PageService();         // Switch page or selected setpoint
+		  TaskEnter(TASK_RPG);
+		  RPG();                 // Update DELRPG value
+		  TaskEnter(TASK_BOUND);
+		  SelectBound();         // Change a target value based on DELRPG
+		  TaskEnter(TASK_CAL);
+		  CalService();          // Reference entry and host commands
+	  }
+	  else
+	  {
+		  TaskEnter(TASK_BOUND);
+		  AlarmButton(!_RB0);    // Pushbutton only acknowledges alarms
+	  }
+	  TaskEnter(TASK_HUMID);
 	  ReadHumidity();            // Read relative humidity every 2 sec
+	  TaskEnter(TASK_TEMP);
 	  ReadTemp();                // Read temperature every 2 sec
-	  CheckAlerts();             // Check to update alerts
+	  TaskEnter(TASK_EVENTS);
+	  EventDispatch();           // Run alerts, metrics and display on new data
+	  TaskEnter(TASK_IDLE);
+	  Supervise();               // Feed the watchdog if all deadlines were met
       
       while (!_T5IF) ;           // Loop time = 10 ms
       _T5IF = 0;
@@ -138,266 +417,467 @@ int main()
 
 /****** Initial ********************************************************
  *
- * Initialize LCD Screen (PMP + configuration + initial display).
+ * Initialize LCD Screen (PMP + configuration + initial display),
+ * unless restarting in degraded mode after a fault.
  * Initialize Timer5 for a loop time of 10 ms.
  **********************************************************************/
 void Initial()
 {
+   InitSupervisor();             // Record reset cause, pick degraded mode
    AD1PCFGL = 0xFFFF;            // Make all ADC pins default to digital pins
-   PMP_Init();                   // Configure PMP module for LCD
-   LCD_Init();                   // Configure LCD controller
    InitRPG(); // Initialize the RPG
-   InitBackground();             // Paint screen royal blue
-   DisplayHandle();              // Display handle
-   InitDisplay();
+   InitCal();                    // Build the correction table from flash
+   if (!Degraded)
+   {
+      PMP_Init();                // Configure PMP module for LCD
+      LCD_Init();                // Configure LCD controller
+      SwitchPage(PAGE_LIVE);     // Paint background, handle and live page
+   }
    _TRISD0 = 0;                  // Make RD0 an output (pin 50 of Mikro board)
+   InitAlarm();                  // Drive the RD0 speaker from OC1 PWM
    TMR5 = 0;                     // Clear Timer5
    PR5 = 19999;                  // Set period of Timer5 to 10 ms
    T5CON = 0x8010;               // Clock Timer5 with Fcy/8 = 2 MHz
    
 }
 
-/****** InitDisplay ********************************************************
+/****** RenderLive ********************************************************
  *
- * Initialize all elements of the display.
+ * Draw every element of the live readings page.
  * 
  **********************************************************************/
-void InitDisplay()
+void RenderLive()
 {
 	static char MaxTempLabel[] = "\003\003Max C";
 	static char MaxHumidLabel[] = "\003\020Max H";  // Row 13
 	static char MinHumidLabel[] = "\004\020Min H";
 	static char MinTempLabel[] = "\004\003Min C";
-	DrawRectangle(5, 53, 21, 69, YELLOW);
 	Display(BKGD, MaxTempLabel);
-	
-	DrawRectangle(155, 53, 171, 69, YELLOW);
 	Display(BKGD, MinTempLabel);
-	
-	DrawRectangle(5, 77, 21, 93, YELLOW);
 	Display(BKGD, MaxHumidLabel);
-
-	DrawRectangle(155, 77, 171, 93, YELLOW);
 	Display(BKGD, MinHumidLabel);
 
-	Display(BKGD, TargetStr1);
-
-	Display(BKGD, CurTempStr);
-	Display(BKGD, CurHumidStr);
-	Display(BKGD, CurDewPointStr);
+	DrawAlert(AlarmActive & (1 << ALARM_MAXTEMP) ? RED : BKGD,
+	          AlarmActive & (1 << ALARM_MAXTEMP) ? AlertStr1 : BlankStr1);
+	DrawAlert(AlarmActive & (1 << ALARM_MINTEMP) ? RED : BKGD,
+	          AlarmActive & (1 << ALARM_MINTEMP) ? AlertStr2 : BlankStr2);
+	DrawAlert(AlarmActive & (1 << ALARM_MAXHUMID) ? RED : BKGD,
+	          AlarmActive & (1 << ALARM_MAXHUMID) ? AlertStr3 : BlankStr3);
+	DrawAlert(AlarmActive & (1 << ALARM_MINHUMID) ? RED : BKGD,
+	          AlarmActive & (1 << ALARM_MINHUMID) ? AlertStr4 : BlankStr4);
+
+	LiveRedraw = 1;               // Bars too, not just changed values
+	ShowTemp();
+	ShowHumidity();
+	DewPoint();
+	DisplayMetrics();
+	LiveRedraw = 0;
 }
 
 /****** CheckAlerts ********************************************************
  *
- * Check to see if boundaries have been breeched by measurements
- * 
+ * Check to see if boundaries have been breeched by measurements.
+ * Subscribed to new samples, saved setpoints and snooze expiry.
  **********************************************************************/
-void CheckAlerts()
+void CheckAlerts(Event *ev)
 {
 	static char Alert1Fixed = 0;
 	static char Alert2Fixed = 0;
 	static char Alert3Fixed = 0;
 	static char Alert4Fixed = 0;
+	unsigned int metric_alerts = 0;
+	char id;
 	
 	if(CurrentTemp < (float)MinTemp && Alert2Fixed == 0)
 	{
 		Alert2Fixed = 1;
-		Display(RED, AlertStr2);
+		DrawAlert(RED, AlertStr2);
 	}
 	else if(CurrentTemp >= (float)MinTemp && Alert2Fixed ==1)
 	{
 		Alert2Fixed = 0;
-		Display(BKGD, BlankStr2);
+		DrawAlert(BKGD, BlankStr2);
 	}
 
 	if(((CurrentTemp - MaxTemp) > 0) && (Alert1Fixed == 0))
 	{
 		Alert1Fixed = 1;
-		Display(RED, AlertStr1);
+		DrawAlert(RED, AlertStr1);
 	}
 	else if(CurrentTemp <= (MaxTemp*1.00) && Alert1Fixed ==1)
 	{
 		Alert1Fixed = 0;
-		Display(BKGD, BlankStr1);
+		DrawAlert(BKGD, BlankStr1);
 	}
 
 	if(CurrentHumidity > (float)MaxHumid && Alert3Fixed == 0)
 	{
 		Alert3Fixed = 1;
-		Display(RED, AlertStr3);
+		DrawAlert(RED, AlertStr3);
 	}
 	else if(CurrentHumidity <= (float)MaxHumid && Alert3Fixed ==1)
 	{
 		Alert3Fixed = 0;
-		Display(BKGD, BlankStr3);
+		DrawAlert(BKGD, BlankStr3);
 	}
 
 	if(CurrentHumidity < (float)MinHumid && Alert4Fixed == 0)
 	{
 		Alert4Fixed = 1;
-		Display(RED, AlertStr4);
+		DrawAlert(RED, AlertStr4);
 	}
 	else if(CurrentHumidity >= (float)MinHumid && Alert4Fixed ==1)
 	{
 		Alert4Fixed = 0;
-		Display(BKGD, BlankStr4);
+		DrawAlert(BKGD, BlankStr4);
+	}
+
+	if(MetricsValid)
+	{
+		for(id = 0; id < METRIC_COUNT; id++)
+		{
+			if(MetricMax[id] != METRIC_OFF && Metric[id] > MetricMax[id]*MetricUnit[id])
+			{
+				metric_alerts |= 1 << id;
+			}
+		}
+	}
+	if(metric_alerts != MetricAlerts)
+	{
+		MetricAlerts = metric_alerts;
+		if(Page == PAGE_LIVE)
+		{
+			DewPoint();           // Redraw metrics in their alert colors
+			DisplayMetrics();
+		}
 	}
 
-   if(Alert1Fixed || Alert2Fixed || Alert3Fixed || Alert4Fixed)
+   AlarmUpdate((Alert1Fixed << ALARM_MAXTEMP) | (Alert2Fixed << ALARM_MINTEMP) |
+               (Alert3Fixed << ALARM_MAXHUMID) | (Alert4Fixed << ALARM_MINHUMID) |
+               (MetricAlerts << ALARM_METRICS));
+	
+}
+
+/****** DrawAlert ********************************************************
+ *
+ * Show or blank an alert marker while the live page is on screen.
+ *
+ **********************************************************************/
+void DrawAlert(unsigned int color, char *str)
+{
+   if (Page == PAGE_LIVE)
+   {
+      Display(color, str);
+   }
+}
+
+/****** InitAlarm ********************************************************
+ *
+ * Route OC1 to RD0 (RP11) in edge-aligned PWM mode, self-synced so that
+ * OC1RS sets the tone period and OC1R the duty cycle.
+ * Timer4 interrupts every 100 ms to step the on/off cadence, so tone
+ * generation costs no main-loop time.
+ **********************************************************************/
+void InitAlarm()
+{
+   __builtin_write_OSCCONL(OSCCON & 0xBF);   // Unlock peripheral pin select
+   RPOR5bits.RP11R = 18;         // OC1 output on RP11/RD0
+   __builtin_write_OSCCONL(OSCCON | 0x40);   // Lock peripheral pin select
+
+   OC1R = 0;                     // Duty of zero keeps the speaker quiet
+   OC1RS = TonePeriod[SEV_ADVISORY];
+   OC1CON2 = 0x001F;             // Sync to OC1 itself (period from OC1RS)
+   OC1CON1 = 0x1C06;             // Clock from Fcy, edge-aligned PWM mode
+
+   TMR4 = 0;                     // Clear Timer4
+   PR4 = 6249;                   // Set period of Timer4 to 100 ms
+   T4CON = 0x8030;               // Clock Timer4 with Fcy/256 = 62.5 kHz
+   _T4IF = 0;
+   _T4IE = 1;                    // Enable the cadence interrupt
+}
+
+/****** _T4Interrupt ********************************************************
+ *
+ * Step the cadence of the tone currently selected by AlarmTone, count
+ * down the snooze period and keep the 100 ms system tick. auto_psv,
+ * because the const tone tables are read through the PSV window.
+ *
+ **********************************************************************/
+void __attribute__((interrupt, auto_psv)) _T4Interrupt(void)
+{
+   signed char tone = AlarmTone;
+   unsigned int duty = 0;
+
+   static char Tenths = 0;
+
+   _T4IF = 0;
+   SysTicks++;
+   if (++Tenths == 10)
    {
-      _LATD0 = 1; // Sound alarm speaker
+      Tenths = 0;
+      Uptime++;
    }
-   else
+   if (SnoozeTicks && --SnoozeTicks == 0)
    {
-      _LATD0 = 0; // Turn speaker off
+      Publish(EV_SNOOZE, 0, 0);  // Let acknowledged alarms sound again
    }
-	
+   if (tone >= 0)
+   {
+      if (ToneCadence[tone] & (1 << CadenceSlot))
+      {
+         duty = TonePeriod[tone] >> 1;   // 50% duty square wave
+      }
+      CadenceSlot = (CadenceSlot + 1) & 0x0F;
+      OC1RS = TonePeriod[tone];
+   }
+#ifdef ALARM_TRACE
+   if (duty != OC1R || OC1RS != TraceLog[(TraceHead - 1) & (TRACE_LEN - 1)][1])
+   {
+      TraceLog[TraceHead][0] = SysTicks;
+      TraceLog[TraceHead][1] = OC1RS;
+      TraceLog[TraceHead][2] = duty;
+      TraceHead = (TraceHead + 1) & (TRACE_LEN - 1);
+   }
+#endif
+   OC1R = duty;
+}
+
+/****** AlarmUpdate ********************************************************
+ *
+ * Take the set of breached alarm sources and choose what to play.
+ * Sources that cleared lose their acknowledgement, acknowledgements
+ * lapse when the snooze runs out, and the highest-priority source left
+ * unacknowledged picks the tone.
+ **********************************************************************/
+void AlarmUpdate(unsigned int active)
+{
+   signed char top;
+   signed char tone = -1;
+
+   AlarmActive = active;
+   AlarmAcked &= active;         // A cleared source must re-alarm next time
+   if (SnoozeTicks == 0)
+   {
+      AlarmAcked = 0;            // Snooze expired
+   }
+
+   top = AlarmTop();
+   if (top >= 0)
+   {
+      tone = AlarmSeverity[top];
+   }
+   if (tone != AlarmTone)
+   {
+      CadenceSlot = 0;           // Start the new pattern from its first slot
+      AlarmTone = tone;
+   }
+}
+
+/****** AlarmTop ********************************************************
+ *
+ * Return the highest-priority unacknowledged alarm, or -1 if none.
+ *
+ **********************************************************************/
+signed char AlarmTop()
+{
+   unsigned int pending = AlarmActive & ~AlarmAcked;
+   signed char id;
+
+   for (id = 0; id < ALARM_COUNT; id++)
+   {
+      if (pending & (1 << id))
+      {
+         return id;
+      }
+   }
+   return -1;
+}
+
+/****** AlarmButton ********************************************************
+ *
+ * Acknowledge every active alarm when the RB0 pushbutton is pressed
+ * while one is sounding, and snooze them for ALARM_SNOOZE_TICKS.
+ * Returns 1 while the press belongs to the alarm so that it is not
+ * also taken as a setpoint confirmation.
+ **********************************************************************/
+char AlarmButton(char pressed)
+{
+   static char Held = 0;         // Current press was used to acknowledge
+
+   if (!pressed)
+   {
+      Held = 0;
+   }
+   else if (!Held && AlarmTop() >= 0)
+   {
+      Held = 1;
+      AlarmAcked = AlarmActive;
+      SnoozeTicks = ALARM_SNOOZE_TICKS;
+      AlarmUpdate(AlarmActive);  // Silence right away
+   }
+   return Held;
+}
+
+/****** InitSupervisor ********************************************************
+ *
+ * Save the reset cause and the task that was running when it happened
+ * into persistent RAM. A watchdog, trap or illegal-opcode reset brings
+ * the board back up in degraded mode: sensors and alarm only.
+ **********************************************************************/
+void InitSupervisor()
+{
+   ResetCause = RCON;
+   RCON = 0;                     // Clear flags so the next cause is distinct
+   if (PersistKey != PERSIST_KEY || (ResetCause & 0x0003))
+   {
+      PersistKey = PERSIST_KEY;  // Power-on or brown-out: RAM holds garbage
+      WdtResets = 0;
+      LastTask = TASK_NONE;
+#ifdef SUPERVISOR_TEST
+      HangTask = TASK_NONE;
+#endif
+   }
+   ResetTask = LastTask;
+   LastTask = TASK_NONE;
+
+   if (ResetCause & RCON_FAULTS)
+   {
+      WdtResets++;
+      Degraded = 1;
+   }
+
+   TMR3 = 0;                     // Free-running task timer
+   PR3 = 0xFFFF;
+   T3CON = 0x8030;               // Clock Timer3 with Fcy/256 = 62.5 kHz
+}
+
+/****** TaskEnter ********************************************************
+ *
+ * Note which task is about to run so a reset can be traced to it, and
+ * start timing it. After a budget overrun LastTask keeps the culprit.
+ **********************************************************************/
+void TaskEnter(char id)
+{
+   TaskStart[id] = TMR3;
+   if (FaultTask == TASK_NONE)
+   {
+      LastTask = id;
+   }
+#ifdef SUPERVISOR_TEST
+   if (HangTask == id)
+   {
+      HangTask = TASK_NONE;      // Hang once; the reset must recover
+      while (1) ;
+   }
+#endif
+}
+
+/****** TaskDone ********************************************************
+ *
+ * Stamp a critical task as having completed now and check how long it
+ * took against its budget. A task over budget latches FaultTask; one
+ * that was slow but within budget excuses this loop's overrun.
+ **********************************************************************/
+void TaskDone(char id)
+{
+   unsigned int elapsed = TMR3 - TaskStart[id];
+
+   TaskStamp[id] = SysTicks;
+   if (TaskBudget[id] && elapsed > TaskBudget[id])
+   {
+      if (FaultTask == TASK_NONE)
+      {
+         FaultTask = id;
+         LastTask = id;          // Blame it for the coming reset
+      }
+   }
+   else if (elapsed > LOOP_COUNTS)
+   {
+      Excused = 1;
+   }
+}
+
+/****** Supervise ********************************************************
+ *
+ * Clear the watchdog only if every critical task met its budget and its
+ * deadline. A loop that passes 10 ms (_T5IF already set) is an overrun
+ * unless a timed task within budget explains it; after more than
+ * OVERRUN_LIMIT in a row, or any budget fault, the supervisor stops
+ * checking in for good and the WDT resets the board.
+ **********************************************************************/
+void Supervise()
+{
+   static char Overruns = 0;
+   unsigned int now = SysTicks;
+   char id;
+
+   if (_T5IF && !Excused)
+   {
+      Overruns++;
+   }
+   else if (!_T5IF && Overruns <= OVERRUN_LIMIT)
+   {
+      Overruns = 0;
+   }
+   Excused = 0;
+   if (FaultTask != TASK_NONE || Overruns > OVERRUN_LIMIT)
+   {
+      return;                    // Latched: wait for the reset
+   }
+
+   for (id = 0; id < TASK_COUNT; id++)
+   {
+      if (TaskDeadline[id] && (now - TaskStamp[id]) > TaskDeadline[id])
+      {
+         return;                 // Missed deadline, let the WDT fire
+      }
+   }
+   ClrWdt();                     // Check in
 }
 
 /****** SelectBound ********************************************************
  *
- * Modify the bounds of a target based on change in DELRPG
- * 
+ * Modify the selected setpoint based on change in DELRPG and save it
+ * when the pushbutton is pressed. Only active on the setpoint page.
  **********************************************************************/
 void SelectBound()
 {
-	int temp_value;
-	char make_change = 0;
+	char changed = 0;
 	
 
 	IsConfirmed = !_RB0;      // Check wether pushbutton is pressed
-	if(IsConfirmed)
+	if(AlarmButton(IsConfirmed))
 	{
-		IsConfirmed = 0;      // Reset value to zero
-		make_change = 1;
+		IsConfirmed = 0;      // Press acknowledged an alarm instead
 	}
-	
-	if(TargetChange == 0)     // Modify Max Temp
+	if(Page != PAGE_SETPOINT)
 	{
-		if(make_change)
-		{
-			make_change = 0;
-			MaxTemp = MaxTempCpy;
-		}
-
-		if(DELRPG ==1 && MaxTempCpy < 50)
-		{
-			
-			MaxTempCpy += 1;  // Increment MaxTemp value
-		}
-		else if(DELRPG == -1 && MaxTempCpy > -10)
-		{
-			MaxTempCpy -= 1;  // Decrement MaxTemp
-		}
-		temp_value = MaxTempCpy;
-		if(MaxTempCpy < 0)
-		{
-			TargetStr1[11] = '-';
-			temp_value = temp_value * -1;
-		}
-		else
-		{
-			TargetStr1[11] = ' ';
-		}
-		TargetStr1[12] ='0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr1[13] ='0' + temp_value;
-		Display(BKGD, TargetStr1);
+		return;
 	}
-	else if(TargetChange == 1)    // Modify Max Humidity
-	{
-
-		if(make_change)
-		{
-			make_change = 0;
-			MaxHumid = MaxHumidCpy;
-		}
-
-		if(DELRPG ==1 && MaxHumidCpy < 100)
-		{
-			
-			MaxHumidCpy += 1;    // Increment MaxHumid value
-		}
-		else if(DELRPG == -1 && MaxHumidCpy > 0)
-		{
-			MaxHumidCpy -= 1;    // Decrement MaxTemp
-		}
-		temp_value = MaxHumidCpy;
-		
-		TargetStr2[13] ='0' + temp_value/100;
-		temp_value = temp_value % 100;
-		TargetStr2[14] = '0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr2[15] ='0' + temp_value;		
 
-		Display(BKGD, TargetStr2);
-	}
-	else if(TargetChange == 2)   // Modifty Min Temp
+	if(IsConfirmed && EditValue != *Setpoint[Selected])
 	{
+		*Setpoint[Selected] = EditValue;  // Confirm the new value
+		changed = 1;
+		Publish(EV_SETPOINT, 0, 0);       // Re-check alerts against it
+	}
+	IsConfirmed = 0;          // Reset value to zero
 
-		if(make_change)
-		{
-			make_change = 0;
-			MinTemp = MinTempCpy;
-		}
-
-		if(DELRPG ==1 && MinTempCpy < 50)
-		{
-			
-			MinTempCpy += 1;    // Increment MinTemp value
-		}
-		else if(DELRPG == -1 && MinTempCpy > -10)
-		{
-			MinTempCpy -= 1;    // Decrement MaxTemp
-		}
-		temp_value = MinTempCpy;
-		if(MinTempCpy < 0)
-		{
-			TargetStr3[11] = '-';
-			temp_value = temp_value * -1;
-		}
-		else
-		{
-			TargetStr3[11] = ' ';
-		}
-		TargetStr3[12] ='0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr3[13] ='0' + temp_value;
-
-		Display(BKGD, TargetStr3);
-
+	if(DELRPG == 1 && EditValue < SetpointHigh[Selected])
+	{
+		EditValue += 1;       // Increment setpoint
+		changed = 1;
 	}
-	else  // Modify Min Humidity
+	else if(DELRPG == -1 && EditValue > SetpointLow[Selected])
 	{
-
-		if(make_change)
-		{
-			make_change = 0;
-			MinHumid = MinHumidCpy;
-		}
-
-		if(DELRPG ==1 && MinHumidCpy < 100)
-		{
-			
-			MinHumidCpy += 1;    // Increment MaxHumid value
-		}
-		else if(DELRPG == -1 && MinHumidCpy > 0)
-		{
-			MinHumidCpy -= 1;    // Decrement MaxTemp
-		}
-		temp_value = MinHumidCpy;
-		
-		TargetStr4[13] ='0' + temp_value/100;
-		temp_value = temp_value % 100;
-		TargetStr4[14] = '0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr4[15] ='0' + temp_value;		
-
-		Display(BKGD, TargetStr4);
-
+		EditValue -= 1;       // Decrement setpoint
+		changed = 1;
 	}
-	
 
+	if(changed)
+	{
+		ShowSetpoint(Selected);
+	}
 }
 
 
@@ -411,15 +891,8 @@ void ReadHumidity()
 
 	static int HUMID_COUNT = 0;
 
-	static int prevRead = 0;
-
    int response;
-   int temp_response;
-   char printPermit = 0;
    float floatVal;
-   float c1 = -2.0468;
-   float c2 = 0.0367;
-   float c3 = -0.0000015955;
    
 
 	HUMID_COUNT++;
@@ -433,8 +906,6 @@ void ReadHumidity()
 	
    	response = sht15_read_byte16();
       
-      temp_response = response;                   // Make a copy of the humidity #
-
 	  //DisplayInt(6, response);
       //HumidityDec[2] = '0' + (response /1000);  // Thousands place 
       //response = response%1000;
@@ -445,14 +916,31 @@ void ReadHumidity()
       //HumidityDec[5] = '0'+ (response);         // Ones place
       //Display(BKGD, HumidityDec);
 
-	  // Calculate relative humidity:
-      floatVal = c1 + (c2*temp_response) + (c3*(temp_response*temp_response));
+      floatVal = RelHumidity(response, SensorTemp);   // Compensated for the last temperature
+
+      TaskDone(TASK_HUMID);
+      Publish(EV_PAIR, SensorTemp, floatVal);    // Humidity with its own temperature
+	}
+
+}
+
+/****** ShowHumidity ********************************************************
+ *
+ * Display the current humidity and its bar graph
+ * 
+ **********************************************************************/
+void ShowHumidity()
+{
+
+	static int prevRead = 0;
 
-      CurrentHumidity = floatVal;                // Save humidity to global variable
+   int temp_response;
+   char printPermit = 0;
+   float floatVal = CurrentHumidity;
 
 	  temp_response = (int)floatVal;             // Truncate float value to integer
 
-	  if(temp_response != prevRead)
+	  if(temp_response != prevRead || LiveRedraw)
 	  {
 		  prevRead = temp_response;
 		  printPermit = 1;  // allow redraw for bar graph
@@ -478,9 +966,6 @@ void ReadHumidity()
 	  	DrawRectangle(5,125,5+130,141,BKGD);    // Clear graph
 	  	DrawRectangle(5,125,5+(temp_response),141, LIME);
 	  }
-	  
-      DewPoint();                              // Calculate Dew Point
-	}
 
 }
 
@@ -492,15 +977,9 @@ void ReadHumidity()
 void ReadTemp()
 {
 
-	static int prevRead = 0;
-
 	static int TEMP_COUNT = 50;
    int response;
-   int temp_response;
    float floatVal;
-   float d1 = -39.7;
-   float d2 = 0.01;
-	char printPermit = 0;
    
 
 	TEMP_COUNT++;
@@ -514,7 +993,8 @@ void ReadTemp()
 	
    	response = sht15_read_byte16();
    
-      temp_response = response;                // Save a copy of temperature
+	  SensorRaw = response;                    // Save a copy of temperature
+	  SensorValid = 1;
 	  //DisplayInt(8, response);
       //TempDec[2] = '0' + (response /10000);
       //response = response%10000;
@@ -527,13 +1007,32 @@ void ReadTemp()
       //TempDec[6] = '0'+ (response);          // Ones place
       //Display(BKGD, TempDec);
 
-      floatVal = d1 + (d2*temp_response);
+      floatVal = CalCorrect(SensorRaw)*0.01;  // Datasheet conversion plus unit trim
+
+	  SensorTemp = floatVal;                   // Kept for humidity compensation
+	  TaskDone(TASK_TEMP);
+	  Publish(EV_TEMP, floatVal, 0);
+	}
+
+}
+
+/****** ShowTemp ********************************************************
+ *
+ * Display the current temperature and its bar graph
+ * 
+ **********************************************************************/
+void ShowTemp()
+{
+
+	static int prevRead = 0;
 
-	  CurrentTemp = floatVal;                  // Save temp to global variable
+   int temp_response;
+   float floatVal = CurrentTemp;
+	char printPermit = 0;
 
 	  temp_response = (int)floatVal;           // Convert to int value and store in temp_val
 
-	  if(prevRead != temp_response)
+	  if(prevRead != temp_response || LiveRedraw)
 	  {
 		  prevRead = temp_response;
 		  printPermit = 1;
@@ -557,36 +1056,29 @@ void ReadTemp()
 	  	DrawRectangle(5,101,5+130,117,BKGD); // Clear graph
 	  	DrawRectangle(5,101,5+(2*temp_response),117, LIME);
 	  }
-	}
 
 }
 
 /****** DewPoint ********************************************************
  *
- * Calculate approximate dew point based on current temp and humidity
- * Then display the current dew point on the LCD
+ * Display the current dew point on the LCD, in red while it is
+ * over its alert limit
  *
  **********************************************************************/
 void DewPoint()
 {
 
 	static char prevRead = 0;
-   float Tn = 243.12;
-   float m = 17.62;
-   float RH = CurrentHumidity;
-   float T = CurrentTemp;
-   float Dewpoint;
+   float Dewpoint = Metric[METRIC_DEWPOINT];
    int DewPntCpy;
    int intVal;
 	char printPermit = 0;
-
-   Dewpoint = Tn*((log(RH/100)+((m*T)/(Tn+T)))/(m-log(RH/100)-((m*T)/(Tn+T)))); // Calculate current dewpoint
 	
    DewPntCpy = ((int)Dewpoint) + 10;     // Save int value of dewpoint + 10;
    
    intVal = (int)Dewpoint;               // Cast to integer and store result in inVal
 	
-	if(intVal != prevRead)
+	if(intVal != prevRead || LiveRedraw)
 	{
 		prevRead = intVal;
 	    printPermit = 1;
@@ -601,7 +1093,7 @@ void DewPoint()
    intVal = (int)(Dewpoint*100);        // Multiply by 100 and convert to integer
    intVal = intVal % 10;                // Get the 100th's place
    CurDewPointStr[14] = '0' + intVal;   // Hundredth's place after decimal
-   Display(BKGD, CurDewPointStr);
+   Display((MetricAlerts & (1 << METRIC_DEWPOINT)) ? RED : BKGD, CurDewPointStr);
 
    if(printPermit)
 	{
@@ -610,136 +1102,790 @@ void DewPoint()
 	}
 }
 
+/****** DerivedMetrics ********************************************************
+ *
+ * Update the metrics shown and alarmed on from one temperature/humidity
+ * pair.
+ *
+ **********************************************************************/
+void DerivedMetrics(float T, float RH)
+{
+   ComputeMetrics(T, RH, Metric);
+   MetricsValid = 1;
+}
 
-/****** InitRPG ********************************************************
+/****** DisplayMetrics ********************************************************
  *
- * Initialize the RPG by enabling internal pullups on RB0,RB2,RB3.
+ * Display heat index, absolute humidity and VPD, in red while over
+ * their alert limits
  *
  **********************************************************************/
-void InitRPG()
+void DisplayMetrics()
 {
-   _CN2PUE = 1;                  // Enable pullup on RB0/CN2 for pushbutton
-   _CN4PUE = 1;                  // Enable pullup on RB2/CN4 for RPGx
-   _CN5PUE = 1;                  // Enalbe pullup on RB3/CN5 for RPGy
-   Nop();                        // Pause for one cycle (i.e., one microsecond)
-   OLDRPG = (PORTB & 0x000C);    // Form initial value of OLDRPG
+   FormatFixed(HeatIndexStr, 11, 3, 1, Metric[METRIC_HEATINDEX]);   // -13.6 to 206.2 C
+   Display((MetricAlerts & (1 << METRIC_HEATINDEX)) ? RED : BKGD, HeatIndexStr);
+
+   FormatFixed(AbsHumidStr, 10, 2, 1, Metric[METRIC_ABSHUMID]);
+   Display((MetricAlerts & (1 << METRIC_ABSHUMID)) ? RED : BKGD, AbsHumidStr);
+
+   FormatFixed(VPDStr, 7, 2, 2, Metric[METRIC_VPD]);                 // Up to 12.3 kPa
+   Display((MetricAlerts & (1 << METRIC_VPD)) ? RED : BKGD, VPDStr);
 }
 
-/***********************************************************************
- * RPG
+/****** FormatFixed ********************************************************
+ *
+ * Write value into str at pos as digits integer digits, then a decimal
+ * point and decimals fraction digits if decimals is nonzero. A negative
+ * value puts '-' in place of the leading digit.
  *
- * This function checks the rotary pulse generator for a change.
- * DELRPG = 0 for no change; +1 for a CW change; -1 for a CCW change.
  **********************************************************************/
-void RPG()
+void FormatFixed(char *str, char pos, char digits, char decimals, float value)
 {
-   DELRPG = 0;                   // Reset DELRPG to a default output value of zero
-   NEWRPG = (PORTB & 0x000C);    // Read in NEWRPG
+   long scaled;
+   signed char i;
+   char neg = (value < 0);
 
-   if (NEWRPG != OLDRPG)         // A change has occurred
+   if (neg)
    {
-      if (0x0008 & (OLDRPG ^ (NEWRPG << 1)))    // Counter-clockwise
+      value = -value;
+   }
+   for (i = 0; i < decimals; i++)
+   {
+      value *= 10;
+   }
+   scaled = (long)(value + 0.5);    // Round to the last place shown
+
+   for (i = digits + decimals; i > digits; i--)
+   {
+      str[pos + i] = '0' + scaled % 10;
+      scaled /= 10;
+   }
+   if (decimals)
+   {
+      str[pos + digits] = '.';
+   }
+   for (i = digits - 1; i >= 0; i--)
+   {
+      str[pos + i] = '0' + scaled % 10;
+      scaled /= 10;
+   }
+   if (neg)
+   {
+      str[pos] = '-';
+   }
+}
+
+
+/****** FormatHex ********************************************************
+ *
+ * Write value into str at pos as digits upper-case hex digits.
+ *
+ **********************************************************************/
+void FormatHex(char *str, char pos, char digits, unsigned int value)
+{
+   signed char i;
+   char nibble;
+
+   for (i = digits - 1; i >= 0; i--)
+   {
+      nibble = value & 0x0F;
+      str[pos + i] = (nibble < 10) ? ('0' + nibble) : ('A' + nibble - 10);
+      value >>= 4;
+   }
+}
+
+/****** Publish ********************************************************
+ *
+ * Queue an event for EventDispatch(). Safe to call from an ISR: the
+ * queue is updated with interrupts masked. A full queue drops the event.
+ *
+ **********************************************************************/
+void Publish(char type, float temp, float humid)
+{
+   int ipl;
+   unsigned char head;
+
+   SET_AND_SAVE_CPU_IPL(ipl, 7);   // Keep the Timer4 ISR out
+   head = EventHead;
+   if (((head + 1) & (EVENT_QLEN - 1)) == EventTail)
+   {
+      EventDrops++;
+   }
+   else
+   {
+      EventQueue[head].type = type;
+      EventQueue[head].temp = temp;
+      EventQueue[head].humid = humid;
+      EventHead = (head + 1) & (EVENT_QLEN - 1);
+   }
+   RESTORE_CPU_IPL(ipl);
+}
+
+/****** EventDispatch ********************************************************
+ *
+ * Hand each queued event to its subscribers. With nothing queued this
+ * returns at once, so idle loops cost almost nothing.
+ *
+ **********************************************************************/
+void EventDispatch()
+{
+   Event ev;
+   char k;
+
+   while (EventTail != EventHead)
+   {
+      ev = EventQueue[EventTail];   // Copy out before freeing the slot
+      EventTail = (EventTail + 1) & (EVENT_QLEN - 1);
+      for (k = 0; k < EV_SUBS && Subscribers[ev.type][k]; k++)
       {
-         DELRPG = +1;
+         Subscribers[ev.type][k](&ev);
       }
-      else                       // Clockwise
+   }
+   TaskDone(TASK_EVENTS);
+}
+
+/****** StoreSample ********************************************************
+ *
+ * Keep the latest readings for alerts and pages. Derived metrics are
+ * computed from the pair in the event, never from mixed globals.
+ *
+ **********************************************************************/
+void StoreSample(Event *ev)
+{
+   if (ev->type == EV_TEMP)
+   {
+      CurrentTemp = ev->temp;
+   }
+   else
+   {
+      CurrentHumidity = ev->humid;
+      DerivedMetrics(ev->temp, ev->humid);   // Dew point, heat index, etc.
+   }
+}
+
+/****** DisplayEvent ********************************************************
+ *
+ * Update the live page with a new sample when it is on screen.
+ *
+ **********************************************************************/
+void DisplayEvent(Event *ev)
+{
+   if (Page != PAGE_LIVE)
+   {
+      return;
+   }
+   if (ev->type == EV_TEMP)
+   {
+      ShowTemp();
+   }
+   else
+   {
+      ShowHumidity();
+      DewPoint();                // Display Dew Point
+      DisplayMetrics();          // Display the other metrics
+   }
+}
+
+/****** InitCal ********************************************************
+ *
+ * Load the saved reference points from flash, if any, and build the
+ * correction table.
+ *
+ **********************************************************************/
+void InitCal()
+{
+   unsigned int offset = __builtin_tbloffset(CalFlash);
+   char i;
+
+   TBLPAG = __builtin_tblpage(CalFlash);
+   CalCount = 0;
+   if (__builtin_tblrdl(offset) == CAL_KEY && __builtin_tblrdl(offset + 2) <= CAL_POINTS)
+   {
+      CalCount = __builtin_tblrdl(offset + 2);
+      for (i = 0; i < CalCount; i++)
       {
-         DELRPG = -1;
+         CalMeas[i] = __builtin_tblrdl(offset + 4 + 4*i);
+         CalRefPt[i] = __builtin_tblrdl(offset + 6 + 4*i);
       }
-      OLDRPG = NEWRPG;           // Save changed RPG value for next time
    }
+   CalBuild();
+}
+
+/****** CalMap ********************************************************
+ *
+ * Correct a measured temperature m (0.01 C) using the reference points:
+ * none leaves it alone, one applies an offset, two give offset and gain,
+ * more are joined piecewise-linearly. The end segments extrapolate.
+ **********************************************************************/
+int CalMap(int m)
+{
+   char i;
+
+   if (CalCount == 0)
+   {
+      return m;
+   }
+   if (CalCount == 1)
+   {
+      return m + CalRefPt[0] - CalMeas[0];
+   }
+   for (i = 1; i < CalCount - 1 && m > CalMeas[i]; i++) ;   // Find the segment
+   return CalRefPt[i - 1] + (int)(((long)(m - CalMeas[i - 1])*(CalRefPt[i] - CalRefPt[i - 1]))
+                                  / (CalMeas[i] - CalMeas[i - 1]));
 }
 
+/****** CalBuild ********************************************************
+ *
+ * Precompute the corrected temperature at every table node so that the
+ * per-reading correction is one lookup and an integer interpolation.
+ *
+ **********************************************************************/
+void CalBuild()
+{
+   char j;
 
-/****** DetectTarget ********************************************************
+   for (j = 0; j < CAL_NODES; j++)
+   {
+      CalTable[j] = CalMap((j << CAL_SHIFT) + CAL_D1);
+   }
+}
+
+/****** CalCorrect ********************************************************
  *
- * Update the current Target variable control
+ * Convert a raw temperature reading to corrected 0.01 C.
  *
  **********************************************************************/
+int CalCorrect(unsigned int raw)
+{
+   unsigned char j;
+   int lo;
 
-void DetectTarget()
+   raw &= 0x3FFF;                // 14-bit reading
+   j = raw >> CAL_SHIFT;
+   lo = CalTable[j];
+   return lo + (int)(((long)(CalTable[j + 1] - lo)*(raw & ((1 << CAL_SHIFT) - 1))) >> CAL_SHIFT);
+}
+
+/****** CalCapture ********************************************************
+ *
+ * Pair the latest reading with a reference temperature (0.01 C). A point
+ * within 0.5 C of an existing one replaces it; otherwise it is inserted
+ * in order, dropping the highest point if the list is full. Ignored
+ * until the sensor has been read, so no point is paired with the
+ * placeholder SensorRaw.
+ **********************************************************************/
+void CalCapture(int ref)
 {
+   int meas = SensorRaw + CAL_D1;
+   char i;
+   char j;
 
-   int temp_value;
+   if (!SensorValid)
+   {
+      return;
+   }
 
-   if (BoundsDetect(5, 53, 40, 69))
+   for (i = 0; i < CalCount; i++)
    {
-      TargetChange = 0;          // Save current target value
-	
-	  temp_value = MaxTemp;
-		if(MaxTemp < 0)
-		{
-			TargetStr1[11] = '-';
-			temp_value = temp_value * -1;
-		}
-		else
-		{
-			TargetStr1[11] = ' ';
-		}
-		TargetStr1[12] ='0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr1[13] ='0' + temp_value;
+      if (meas - CalMeas[i] < 50 && CalMeas[i] - meas < 50)
+      {
+         CalRefPt[i] = ref;      // Same spot: take the new reference
+         CalBuild();
+         return;
+      }
+   }
 
-	  MaxTempCpy = MaxTemp;      // Reset the copy
-	  
-	  Display(BKGD, TargetStr1); // Update current target string
+   if (CalCount == CAL_POINTS)
+   {
+      CalCount--;
    }
-   if (BoundsDetect(155, 53, 190, 69))
+   for (i = CalCount; i > 0 && CalMeas[i - 1] > meas; i--) ;    // Insertion point
+   for (j = CalCount; j > i; j--)
    {
-      TargetChange = 1;          // Save current target value
+      CalMeas[j] = CalMeas[j - 1];
+      CalRefPt[j] = CalRefPt[j - 1];
+   }
+   CalMeas[i] = meas;
+   CalRefPt[i] = ref;
+   CalCount++;
+   CalBuild();
+}
 
-	  temp_value = MaxHumid;
-		
-		TargetStr2[13] ='0' + temp_value/100;
-		temp_value = temp_value % 100;
-		TargetStr2[14] = '0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr2[15] ='0' + temp_value;
+/****** CalClear ********************************************************
+ *
+ * Drop all reference points (not yet saved to flash).
+ *
+ **********************************************************************/
+void CalClear()
+{
+   CalCount = 0;
+   CalBuild();
+}
 
-	  MaxHumidCpy = MaxHumid;    // Reset the copy
+/****** CalSave ********************************************************
+ *
+ * Erase the calibration flash page and write the current points to it.
+ *
+ **********************************************************************/
+void CalSave()
+{
+   unsigned int offset = __builtin_tbloffset(CalFlash);
+   char i;
+
+   TBLPAG = __builtin_tblpage(CalFlash);
+   NVMCON = 0x4042;              // Erase one page
+   __builtin_tblwtl(offset, 0);  // Select the page
+   __builtin_write_NVM();
+   while (NVMCONbits.WR) ;
+
+   FlashWord(offset, CAL_KEY);
+   FlashWord(offset + 2, CalCount);
+   for (i = 0; i < CalCount; i++)
+   {
+      FlashWord(offset + 4 + 4*i, CalMeas[i]);
+      FlashWord(offset + 6 + 4*i, CalRefPt[i]);
+   }
+}
 
-	  Display(BKGD, TargetStr2); // Update current target string
+/****** FlashWord ********************************************************
+ *
+ * Program one word at offset in the page selected by TBLPAG.
+ *
+ **********************************************************************/
+void FlashWord(unsigned int offset, unsigned int value)
+{
+   NVMCON = 0x4003;              // Single word write
+   __builtin_tblwtl(offset, value);
+   __builtin_tblwth(offset, 0);
+   __builtin_write_NVM();
+   while (NVMCONbits.WR) ;
+}
+
+/****** CalService ********************************************************
+ *
+ * Run host calibration commands. On the calibration page, let the RPG
+ * set the reference in 0.1 C steps and handle the Capture, Clear and
+ * Save buttons on row 6.
+ **********************************************************************/
+void CalService()
+{
+   static char Held = 0;         // Touch already acted on
+   char cmd = HostCmd;
+
+   if (cmd != HOST_NONE)
+   {
+      if (cmd == HOST_CAPTURE)
+      {
+         CalCapture(HostArg);
+      }
+      else if (cmd == HOST_CLEAR)
+      {
+         CalClear();
+      }
+      else if (cmd == HOST_SAVE)
+      {
+         CalSave();
+      }
+      HostCmd = HOST_NONE;
+      if (Page == PAGE_CAL)
+      {
+         ShowCal();
+      }
    }
-   if (BoundsDetect(5, 77, 40, 93))
+
+   if (Page != PAGE_CAL)
    {
-      TargetChange = 2;          // Save current target value
+      return;
+   }
 
-	  temp_value = MinTemp;
-		if(MinTemp < 0)
-		{
-			TargetStr3[11] = '-';
-			temp_value = temp_value * -1;
-		}
-		else
-		{
-			TargetStr3[11] = ' ';
-		}
-		TargetStr3[12] ='0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr3[13] ='0' + temp_value;
+   if (DELRPG == 1 && CalRef < 12500)
+   {
+      CalRef += 10;
+      ShowCal();
+   }
+   else if (DELRPG == -1 && CalRef > -4000)
+   {
+      CalRef -= 10;
+      ShowCal();
+   }
+
+   if (!BoundsDetect(0, 125, 215, 141))
+   {
+      Held = 0;
+      return;
+   }
+   if (Held)
+   {
+      return;
+   }
+   Held = 1;
+   if (BoundsDetect(0, 125, 83, 141))
+   {
+      CalCapture(CalRef);
+   }
+   else if (BoundsDetect(96, 125, 155, 141))
+   {
+      CalClear();
+   }
+   else if (BoundsDetect(168, 125, 215, 141))
+   {
+      CalSave();
+   }
+   ShowCal();
+}
+
+/****** CalEvent ********************************************************
+ *
+ * Refresh the calibration page with each new temperature.
+ *
+ **********************************************************************/
+void CalEvent(Event *ev)
+{
+   if (Page == PAGE_CAL)
+   {
+      ShowCal();
+   }
+}
+
+/****** RenderCal ********************************************************
+ *
+ * Draw the calibration page.
+ *
+ **********************************************************************/
+void RenderCal()
+{
+   static char CaptureStr[] = "\006\001Capture";
+   static char ClearStr[] = "\006\011Clear";
+   static char SaveStr[] = "\006\017Save";
+
+   Display(GRAY, CaptureStr);
+   Display(GRAY, ClearStr);
+   Display(GRAY, SaveStr);
+   ShowCal();
+}
+
+/****** ShowCal ********************************************************
+ *
+ * Display the raw and corrected sensor temperature, the reference being
+ * entered and the number of points.
+ *
+ **********************************************************************/
+void ShowCal()
+{
+   FormatFixed(CalSensorStr, 13, 3, 2, (SensorRaw + CAL_D1)*0.01);
+   Display(BKGD, CalSensorStr);
+
+   FormatFixed(CalRefStr, 13, 3, 2, CalRef*0.01);
+   Display(BKGD, CalRefStr);
+
+   FormatFixed(CalFixStr, 13, 3, 2, CalCorrect(SensorRaw)*0.01);
+   Display(BKGD, CalFixStr);
+
+   CalPointsStr[10] = '0' + CalCount;
+   Display(BKGD, CalPointsStr);
+}
+
+/****** SwitchPage ********************************************************
+ *
+ * Repaint the screen with the tab row and the chosen page. Pages keep
+ * their data up to date while hidden and are drawn in full only here.
+ *
+ **********************************************************************/
+void SwitchPage(signed char page)
+{
+   char k;
 
-	  MinTempCpy = MinTemp;       // Reset the copy
+   Page = page;
+   InitBackground();             // Wipe the previous page
+   DisplayHandle();
+   for (k = 0; k < PAGE_COUNT; k++)
+   {
+      Display((k == Page) ? GRAY : BKGD, TabStr[k]);
+   }
 
-	  Display(BKGD, TargetStr3);  // Update current target string
+   if (Page == PAGE_LIVE)
+   {
+      RenderLive();
+   }
+   else if (Page == PAGE_SETPOINT)
+   {
+      RenderSetpoints();
+   }
+   else if (Page == PAGE_HISTORY)
+   {
+      RenderHistory();
+   }
+   else if (Page == PAGE_DIAG)
+   {
+      RenderDiag();
    }
-   if (BoundsDetect(155, 77, 190, 93))
+   else
    {
-      TargetChange = 3;           // Save current target value
+      RenderCal();
+   }
+}
 
-	  temp_value = MinHumid;
-		
-		TargetStr4[13] ='0' + temp_value/100;
-		temp_value = temp_value % 100;
-		TargetStr4[14] = '0' + temp_value/10;
-		temp_value = temp_value % 10;
-		TargetStr4[15] ='0' + temp_value;
+/****** PageService ********************************************************
+ *
+ * Switch pages when a tab is touched, select a setpoint when its row is
+ * touched, and refresh the diagnostics page once a second.
+ *
+ **********************************************************************/
+void PageService()
+{
+   static unsigned int DiagStamp = 0;
+   char k;
+
+   for (k = 0; k < PAGE_COUNT; k++)
+   {
+      if (k != Page && BoundsDetect(60*k, 24, 60*k + 53, 48))
+      {
+         SwitchPage(k);
+      }
+   }
+
+   if (Page == PAGE_SETPOINT)
+   {
+      for (k = 0; k < SETPOINT_COUNT; k++)
+      {
+         if (k != Selected && BoundsDetect(0, 24*(k + 2) + 5, 239, 24*(k + 2) + 21))
+         {
+            SelectSetpoint(k);
+         }
+      }
+   }
+   else if (Page == PAGE_DIAG && (SysTicks - DiagStamp) >= 10)
+   {
+      DiagStamp = SysTicks;
+      ShowDiag();
+   }
+}
+
+/****** RenderSetpoints ********************************************************
+ *
+ * Draw every setpoint row of the setpoint page.
+ *
+ **********************************************************************/
+void RenderSetpoints()
+{
+   char k;
+
+   for (k = 0; k < SETPOINT_COUNT; k++)
+   {
+      ShowSetpoint(k);
+   }
+}
+
+/****** ShowSetpoint ********************************************************
+ *
+ * Draw one setpoint row. The selected row is marked with '>' and shows
+ * the value being edited, on yellow until the pushbutton confirms it.
+ * A metric limit at METRIC_OFF reads "off".
+ *
+ **********************************************************************/
+void ShowSetpoint(char k)
+{
+   static char MarkStr[] = "\003\001 ";
+   char value = (k == Selected) ? EditValue : *Setpoint[k];
+
+   MarkStr[0] = k + 3;           // Row of this setpoint
+   MarkStr[2] = (k == Selected) ? '>' : ' ';
+   Display(BKGD, MarkStr);
+
+   FormatFixed(SetpointStr[k], 13, 3, 0, value);
+   if (k >= SETPOINT_METRIC && value == METRIC_OFF)
+   {
+      SetpointStr[k][13] = 'o';
+      SetpointStr[k][14] = 'f';
+      SetpointStr[k][15] = 'f';
+   }
+   Display((value != *Setpoint[k]) ? YELLOW : BKGD, SetpointStr[k]);
+}
+
+/****** SelectSetpoint ********************************************************
+ *
+ * Make setpoint k the one adjusted by the RPG, starting from its saved
+ * value.
+ *
+ **********************************************************************/
+void SelectSetpoint(char k)
+{
+   char previous = Selected;
+
+   Selected = k;
+   EditValue = *Setpoint[k];     // Drop any unconfirmed edit
+   ShowSetpoint(previous);
+   ShowSetpoint(k);
+}
+
+/****** HistoryAdd ********************************************************
+ *
+ * Record every HIST_EVERY-th temperature/humidity pair in the history
+ * ring, and plot it if the history page is on screen.
+ *
+ **********************************************************************/
+void HistoryAdd(Event *ev)
+{
+   static char Count = 0;
+   unsigned char slot;
+
+   if (++Count < HIST_EVERY)
+   {
+      return;
+   }
+   Count = 0;
+
+   slot = HistHead;
+   HistTemp[slot] = (signed char)ev->temp;
+   HistHumid[slot] = (unsigned char)ev->humid;
+   HistHead = (HistHead + 1) % HIST_LEN;
+   if (HistCount < HIST_LEN)
+   {
+      HistCount++;
+   }
+
+   if (Page == PAGE_HISTORY)
+   {
+      PlotColumn(slot);             // Also erases the cursor drawn there
+      PlotColumn(HistHead);         // Cursor moves to the next slot
+   }
+}
+
+/****** RenderHistory ********************************************************
+ *
+ * Draw the whole history plot with its legend.
+ *
+ **********************************************************************/
+void RenderHistory()
+{
+   static char TempLegend[] = "\012\001Temp -10..50 C";
+   static char HumidLegend[] = "\012\021Humid %";
+   unsigned char i;
+
+   for (i = 0; i < HIST_LEN; i++)
+   {
+      PlotColumn(i);
+   }
+   Display(YELLOW, TempLegend);
+   Display(AQUA, HumidLegend);
+}
+
+/****** PlotColumn ********************************************************
+ *
+ * Redraw slot i of the history plot: a 3-pixel column in a sweep from
+ * left to right. The slot to be written next carries a white cursor on
+ * its left edge, so redrawing that slot is all it takes to move it.
+ *
+ **********************************************************************/
+void PlotColumn(unsigned char i)
+{
+   int x = 5 + 3*i;
+   int y;
 
-	  MinHumidCpy = MinHumid;     // Reset the copy
+   DrawRectangle(x, 51, x + 2, 214, BKGD);     // Clear column; markers span y = 51..213
+   if (i == HistHead && HistCount > 0)
+   {
+      DrawRectangle(x, 51, x, 214, WHITE);     // Sweep cursor
+   }
+   if (i >= HistCount)
+   {
+      return;
+   }
 
-	  Display(BKGD, TargetStr4);  // Update current target string
+   y = HistTemp[i];
+   if (y < -10)
+   {
+      y = -10;
    }
+   else if (y > 50)
+   {
+      y = 50;
+   }
+   y = 212 - ((y + 10)*8)/3;                  // -10..50 C over 160 pixels
+   DrawRectangle(x, y - 1, x + 2, y + 1, YELLOW);
+
+   y = 212 - (HistHumid[i]*8)/5;              // 0..100 % over 160 pixels
+   DrawRectangle(x, y - 1, x + 2, y + 1, AQUA);
+}
+
+/****** RenderDiag ********************************************************
+ *
+ * Draw the diagnostics page.
+ *
+ **********************************************************************/
+void RenderDiag()
+{
+   FormatHex(DiagResetStr, 11, 4, ResetCause);
+   DiagResetStr[21] = '0' + ResetTask;
+   Display(BKGD, DiagResetStr);
+
+   FormatFixed(DiagFaultStr, 16, 5, 0, WdtResets);
+   Display(BKGD, DiagFaultStr);
+
+   ShowDiag();
 }
 
+/****** ShowDiag ********************************************************
+ *
+ * Refresh the diagnostics that change while the page is visible.
+ *
+ **********************************************************************/
+void ShowDiag()
+{
+   FormatHex(DiagAlarmStr, 12, 2, AlarmActive);
+   FormatHex(DiagAlarmStr, 21, 2, AlarmAcked);
+   Display(BKGD, DiagAlarmStr);
+
+   FormatFixed(DiagSnoozeStr, 10, 5, 0, SnoozeTicks/10);
+   Display(BKGD, DiagSnoozeStr);
+
+   FormatFixed(DiagUptimeStr, 10, 5, 0, Uptime);
+   Display(BKGD, DiagUptimeStr);
+
+   FormatFixed(DiagDropStr, 15, 5, 0, EventDrops);
+   Display(BKGD, DiagDropStr);
+}
+
+/****** InitRPG ********************************************************
+ *
+ * Initialize the RPG by enabling internal pullups on RB0,RB2,RB3.
+ *
+ **********************************************************************/
+void InitRPG()
+{
+   _CN2PUE = 1;                  // Enable pullup on RB0/CN2 for pushbutton
+   _CN4PUE = 1;                  // Enable pullup on RB2/CN4 for RPGx
+   _CN5PUE = 1;                  // Enalbe pullup on RB3/CN5 for RPGy
+   Nop();                        // Pause for one cycle (i.e., one microsecond)
+   OLDRPG = (PORTB & 0x000C);    // Form initial value of OLDRPG
+}
+
+/***********************************************************************
+ * RPG
+ *
+ * This function checks the rotary pulse generator for a change.
+ * DELRPG = 0 for no change; +1 for a CW change; -1 for a CCW change.
+ **********************************************************************/
+void RPG()
+{
+   DELRPG = 0;                   // Reset DELRPG to a default output value of zero
+   NEWRPG = (PORTB & 0x000C);    // Read in NEWRPG
+
+   if (NEWRPG != OLDRPG)         // A change has occurred
+   {
+      if (0x0008 & (OLDRPG ^ (NEWRPG << 1)))    // Counter-clockwise
+      {
+         DELRPG = +1;
+      }
+      else                       // Clockwise
+      {
+         DELRPG = -1;
+      }
+      OLDRPG = NEWRPG;           // Save changed RPG value for next time
+   }
+}
+
+
 /****** BoundsDetect ********************************************************
  *
  * Detect whether a block has been touched
@@ -0,0 +1,142 @@
+/****** test_metrics.c **********************************************
+ *
+ * Host check of Metrics.c: humidity conversion against SHT1x datasheet
+ * values, heat index against the published NWS table, and the vapor
+ * pressure metrics against the closed-form Magnus formulas. Build and
+ * run from the repository root:
+ *
+ *    cc -o test_metrics tests/test_metrics.c -lm && ./test_metrics
+ *
+ * Exits nonzero if any check fails.
+ *
+ **********************************************************************/
+#include <stdio.h>
+#include "../Metrics.c"
+
+#define MAGNUS_M 17.62
+#define MAGNUS_TN 243.12
+
+int Failures = 0;
+
+/****** Check ********************************************************
+ *
+ * Count and report a failure when got is further than tol from want.
+ * a and b are the inputs, printed to identify the case.
+ *
+ **********************************************************************/
+void Check(const char *what, double a, double b, double got, double want, double tol)
+{
+   if (fabs(got - want) > tol)
+   {
+      printf("FAIL %s at (%.2f, %.0f): got %.4f, want %.4f (tol %.4f)\n",
+             what, a, b, got, want, tol);
+      Failures++;
+   }
+}
+
+/****** Magnus ********************************************************
+ *
+ * Saturation vapor pressure over water in Pa at t C.
+ *
+ **********************************************************************/
+double Magnus(double t)
+{
+   return 611.2*exp(MAGNUS_M*t/(MAGNUS_TN + t));
+}
+
+/****** MagnusDewPoint ********************************************************
+ *
+ * Closed-form Magnus dew point in C.
+ *
+ **********************************************************************/
+double MagnusDewPoint(double t, double rh)
+{
+   double g = log(rh/100) + MAGNUS_M*t/(MAGNUS_TN + t);
+
+   return MAGNUS_TN*g/(MAGNUS_M - g);
+}
+
+// SHT1x datasheet RH polynomial and temperature compensation worked by
+// hand: {raw count, C, %RH}, including both ends of the 0..100 clamp
+const double RhPoints[][3] = {
+   {1500, 25, 49.41}, {2500, 25, 79.73},       // At 25 C: linear term only
+   {1500, 45, 52.01}, {1500, 5, 46.81},        // Compensated warm and cold
+   {2500, 0, 74.48}, {3000, 50, 99.94},
+   {50, 25, 0.0}, {3400, 25, 100.0}};          // -0.22 and 104.29 clamped
+
+// Published NWS heat index table: {F, %RH, heat index F}
+const double HeatIndexTable[][3] = {
+   {80, 40, 80}, {84, 90, 98}, {86, 90, 105}, {90, 70, 106}, {90, 100, 132},
+   {96, 55, 112}, {100, 40, 109}, {100, 50, 118}, {100, 65, 136}, {110, 40, 136}};
+
+int main(void)
+{
+   int t;
+   int tc;
+   int rh;
+   float out[METRIC_COUNT];
+   unsigned int i;
+
+   for (i = 0; i < sizeof(RhPoints)/sizeof(RhPoints[0]); i++)
+   {
+      Check("RelHumidity", RhPoints[i][0], RhPoints[i][1],
+            RelHumidity(RhPoints[i][0], RhPoints[i][1]), RhPoints[i][2], 0.01);
+   }
+
+   // The table is rounded to whole degrees F
+   for (i = 0; i < sizeof(HeatIndexTable)/sizeof(HeatIndexTable[0]); i++)
+   {
+      double f = HeatIndexTable[i][0];
+
+      Check("heat index", f, HeatIndexTable[i][1],
+            HeatIndex((f - 32)/1.8, HeatIndexTable[i][1])*1.8 + 32, HeatIndexTable[i][2], 0.5);
+   }
+
+   // Every table entry is Magnus rounded to the nearest Pa
+   for (t = SVP_TMIN; t <= SVP_TMAX; t++)
+   {
+      Check("SatVaporTable", t, 100, SatVaporTable[t - SVP_TMIN], Magnus(t), 0.5);
+   }
+
+   // Interpolation between entries stays within 0.1%, or 1.5 Pa (entry
+   // rounding plus truncated interpolation) where pressures are small
+   for (tc = SVP_TMIN*100; tc <= SVP_TMAX*100; tc += 37)
+   {
+      double want = Magnus(tc/100.0);
+
+      Check("SatVapor", tc/100.0, 100, SatVapor(tc), want, want > 1500 ? want*0.001 : 1.5);
+   }
+
+   // Quarter-degree offsets keep the checks off the table's own points
+   for (t = -10; t <= 50; t++)
+   {
+      for (rh = 5; rh <= 100; rh += 5)
+      {
+         double tt = t + 0.25;
+         double es = Magnus(tt);
+         double e = es*rh/100;
+         double td = MagnusDewPoint(tt, rh);
+         double ah = 2.1667*e/(tt + 273.15);
+
+         ComputeMetrics(tt, rh, out);
+
+         if (td < SVP_TMIN)            // VaporDewPoint clamps to the table
+         {
+            td = SVP_TMIN;
+         }
+
+         // Truncating e to whole Pa costs more where the curve is flat
+         Check("dew point", tt, rh, out[METRIC_DEWPOINT], td, td >= 0 ? 0.1 : 0.5);
+         Check("abs humidity", tt, rh, out[METRIC_ABSHUMID], ah, 0.02 + ah*0.002);
+         Check("VPD", tt, rh, out[METRIC_VPD], (es - e)/1000, 0.005 + es*0.000002);
+      }
+   }
+
+   if (Failures)
+   {
+      printf("%d checks failed\n", Failures);
+      return 1;
+   }
+   printf("All metric checks passed\n");
+   return 0;
+}